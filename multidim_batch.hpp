@@ -0,0 +1,262 @@
+/**
+ * Multidimensional Static Matrix C++11
+ * Copyright Emanuele Ruffaldi (2015) at Scuola Superiore Sant'Anna Pisa
+ *
+ * Batched tensors: the same TS-shaped factor for a runtime number of instances
+ *
+ * Storage is structure-of-arrays with the batch index innermost: a column-major Eigen matrix
+ * batch x Nstorage where column o holds the element at offset o of every instance. The kernels
+ * below visit the elements through details::foreachoffset (unrolled for small factors) and
+ * operate on whole columns, so the SIMD lanes run across the instances.
+ *
+ * Reductions, normalization, expand and multiply are Eigen column expressions and are vectorized
+ * explicitly. apply/apply2 take an opaque functor that Eigen cannot vectorize: they run plain
+ * pointer loops over the contiguous columns (or the whole storage) that the compiler
+ * auto-vectorizes when it inlines the functor (g++ -O3, or -O2 -ftree-vectorize).
+ *
+ * Under Apache License
+ */
+#pragma once
+#include "multidim_ops.hpp"
+
+namespace multidim
+{
+	/**
+	 * B instances of a TS-shaped factor. Offsets (offset(), offsetvalue) select a column
+	 */
+	template <class T, class TS>
+	class MultiDimNBatch: public MultiDimNBase<T,TS>
+	{
+	public:
+		using base_t = MultiDimNBase<T,TS>;
+		using data_t = Eigen::Matrix<T,Eigen::Dynamic,base_t::Nstorage>;
+		using batchvector_t = Eigen::Array<T,Eigen::Dynamic,1>;
+
+		MultiDimNBatch(int batch): data_(batch,int(base_t::Nstorage)) // int(): no odr-use of Nstorage
+		{
+		}
+
+		int batch() const { return data_.rows(); }
+
+		const T * data() const { return data_.data(); }
+
+		T * data() { return data_.data(); }
+
+		/// all the instances of the element at offset o
+		auto col(int o) -> decltype(std::declval<data_t&>().col(o)) { return data_.col(o); }
+
+		auto col(int o) const -> decltype(std::declval<const data_t&>().col(o)) { return data_.col(o); }
+
+		data_t & storage() { return data_; }
+
+		const data_t & storage() const { return data_; }
+
+		void setOnes()
+		{
+			data_.setOnes();
+		}
+
+		void setZero()
+		{
+			data_.setZero();
+		}
+
+		/// copies a MultiDimN or MultiDimNView with the same sizes into instance b
+		template <class A>
+		void set(int b, const A & x)
+		{
+			static_assert(details::samesizes<TS,typename A::layout_t>::value,"instance requires the same sizes");
+			const T * px = x.data();
+			data_t & d = data_;
+			details::foreachoffset<TS,typename A::layout_t>([&d,px,b] (int o, int ox) { d(b,o) = px[ox]; });
+		}
+
+		/// copies instance b into a MultiDimN or MultiDimNView with the same sizes
+		template <class A>
+		void get(int b, A && x) const
+		{
+			static_assert(details::samesizes<TS,details::layoutof<A> >::value,"instance requires the same sizes");
+			T * px = x.data();
+			const data_t & d = data_;
+			details::foreachoffset<TS,details::layoutof<A> >([&d,px,b] (int o, int ox) { px[ox] = d(b,o); });
+		}
+
+	private:
+		data_t data_;
+	};
+
+	/// declares a batched multidim with type T and given dimensions in row-major
+	template <class T, int...N>
+	using MultiDimNBatchRow = MultiDimNBatch<T, typename details::rowmajorstepper<N...> >;
+
+	/// a = f(a) for every element of every instance
+	template <class T, class TS, class F>
+	void apply(MultiDimNBatch<T,TS> & a, F f)
+	{
+		MULTIDIM_PROBE("batch_apply", TS, details::kernelpathof<TS>::value, (long)details::productseq<TS>::value*a.batch(), 2L*details::productseq<TS>::value*a.batch()*sizeof(T));
+		// padding columns included: they are never read back
+		T * pa = a.data();
+		const std::ptrdiff_t n = a.storage().size();
+		for(std::ptrdiff_t i = 0; i < n; i++)
+			pa[i] = f(pa[i]);
+	}
+
+	/// a = f(a,b) element-wise between the instances of two batches of the same size
+	template <class T, class TSA, class TSB, class F>
+	void apply2(MultiDimNBatch<T,TSA> & a, const MultiDimNBatch<T,TSB> & b, F f)
+	{
+		static_assert(details::samesizes<TSA,TSB>::value,"operands require the same sizes");
+		assert(a.batch() == b.batch());
+		MULTIDIM_PROBE("batch_apply2", TSA, (details::kernelpathof<TSA,TSB>::value), (long)details::productseq<TSA>::value*a.batch(), 3L*details::productseq<TSA>::value*a.batch()*sizeof(T));
+		T * pa = a.data();
+		const T * pb = b.data();
+		const int n = a.batch();
+		if(std::is_same<TSA,TSB>::value)
+		{
+			const std::ptrdiff_t m = a.storage().size();
+			for(std::ptrdiff_t i = 0; i < m; i++)
+				pa[i] = f(pa[i],pb[i]);
+		}
+		else
+		{
+			details::foreachoffset<TSA,TSB>([pa,pb,n,&f] (int oa, int ob) 
+			{
+				T * ca = pa + (std::ptrdiff_t)oa*n;
+				const T * cb = pb + (std::ptrdiff_t)ob*n;
+				for(int i = 0; i < n; i++)
+					ca[i] = f(ca[i],cb[i]);
+			});
+		}
+	}
+
+	/// a = f(a,b) element-wise where the single factor b is shared by all the instances
+	template <class T, class TSA, class B, class F>
+	void apply2(MultiDimNBatch<T,TSA> & a, const B & b, F f)
+	{
+		static_assert(details::samesizes<TSA,typename B::layout_t>::value,"operands require the same sizes");
+		MULTIDIM_PROBE("batch_apply2_shared", TSA, (details::kernelpathof<TSA,typename B::layout_t>::value), (long)details::productseq<TSA>::value*a.batch(), (2L*a.batch()+1)*details::productseq<TSA>::value*sizeof(T));
+		const T * pb = b.data();
+		T * pa = a.data();
+		const int n = a.batch();
+		details::foreachoffset<TSA,typename B::layout_t>([pa,pb,n,&f] (int oa, int ob)
+		{
+			const T y = pb[ob];
+			T * ca = pa + (std::ptrdiff_t)oa*n;
+			for(int i = 0; i < n; i++)
+				ca[i] = f(ca[i],y);
+		});
+	}
+
+	/// a *= b element-wise between the instances of two batches of the same size
+	template <class T, class TSA, class TSB>
+	void multiply(MultiDimNBatch<T,TSA> & a, const MultiDimNBatch<T,TSB> & b)
+	{
+		static_assert(details::samesizes<TSA,TSB>::value,"operands require the same sizes");
+		assert(a.batch() == b.batch());
+		MULTIDIM_PROBE("batch_multiply", TSA, (details::kernelpathof<TSA,TSB>::value), (long)details::productseq<TSA>::value*a.batch(), 3L*details::productseq<TSA>::value*a.batch()*sizeof(T));
+		if(std::is_same<TSA,TSB>::value)
+			a.storage().array() *= b.storage().array();
+		else
+			details::foreachoffset<TSA,TSB>([&a,&b] (int oa, int ob) { a.col(oa).array() *= b.col(ob).array(); });
+	}
+
+	/// a *= b element-wise where the single factor b is shared by all the instances
+	template <class T, class TSA, class B>
+	void multiply(MultiDimNBatch<T,TSA> & a, const B & b)
+	{
+		static_assert(details::samesizes<TSA,typename B::layout_t>::value,"operands require the same sizes");
+		MULTIDIM_PROBE("batch_multiply_shared", TSA, (details::kernelpathof<TSA,typename B::layout_t>::value), (long)details::productseq<TSA>::value*a.batch(), (2L*a.batch()+1)*details::productseq<TSA>::value*sizeof(T));
+		const T * pb = b.data();
+		details::foreachoffset<TSA,typename B::layout_t>([&a,pb] (int oa, int ob) { a.col(oa) *= pb[ob]; });
+	}
+
+	/// per instance sum of all the elements
+	template <class T, class TS>
+	auto sum(const MultiDimNBatch<T,TS> & a) -> typename MultiDimNBatch<T,TS>::batchvector_t
+	{
+		MULTIDIM_PROBE("batch_sum", TS, details::kernelpathof<TS>::value, (long)details::productseq<TS>::value*a.batch(), (long)details::productseq<TS>::value*a.batch()*sizeof(T));
+		typename MultiDimNBatch<T,TS>::batchvector_t s = MultiDimNBatch<T,TS>::batchvector_t::Zero(a.batch());
+		details::foreachoffset<TS>([&a,&s] (int oa) { s += a.col(oa).array(); });
+		return s;
+	}
+
+	/// b = sum of a along dim, per instance
+	template <int dim, class T, class TSA, class TSB>
+	void sumout(const MultiDimNBatch<T,TSA> & a, MultiDimNBatch<T,TSB> & b)
+	{
+		static_assert(details::samesizes<typename TSA::template drop<dim>,TSB>::value,"result requires the sizes of the source without dim");
+		assert(a.batch() == b.batch());
+		MULTIDIM_PROBE("batch_sumout", TSA, (details::kernelpathof<TSA,details::dropexpandmake<TSB,dim,TSA> >::value), (long)details::productseq<TSA>::value*a.batch(), (details::productseq<TSA>::value+2L*details::productseq<TSB>::value)*a.batch()*sizeof(T));
+		b.setZero();
+		details::foreachoffset<TSA,details::dropexpandmake<TSB,dim,TSA> >([&a,&b] (int oa, int ob) { b.col(ob) += a.col(oa); });
+	}
+
+	/// b = a replicated over the dimensions of b not listed in I..., per instance
+	template <int...I, class T, class TSA, class TSB>
+	void expand(const MultiDimNBatch<T,TSA> & a, MultiDimNBatch<T,TSB> & b)
+	{
+		static_assert(sizeof...(I) == TSA::size,"one index of the destination for every dimension of the source");
+		static_assert(details::samesizes<TSA,type_sequence<typename TSB::template pick<I>...> >::value,"common dimensions require the same sizes");
+		assert(a.batch() == b.batch());
+		MULTIDIM_PROBE("batch_expand", TSB, (details::kernelpathof<TSB,details::expandmake<TSA,TSB,I...> >::value), (long)details::productseq<TSB>::value*a.batch(), (details::productseq<TSA>::value+details::productseq<TSB>::value)*(long)a.batch()*sizeof(T));
+		details::foreachoffset<TSB,details::expandmake<TSA,TSB,I...> >([&a,&b] (int ob, int oa) { b.col(ob) = a.col(oa); });
+	}
+
+	/**
+	 * Batched evidence conditioning: instance n of out is the factor with the dimensions I... fixed at
+	 * the states evidence(n,0..k-1), that is what limit1<I>(state) applied for every I would select.
+	 *
+	 * evidence is an integer Eigen matrix N x sizeof...(I). The base offsets of the N records are a
+	 * single matrix-vector product with the compile time steps, then every element of the reduced
+	 * factor is streamed into its column of out with a gather over the records
+	 */
+	template <int...I, class A, class Derived, class T, class TSO>
+	void gather(const A & factor, const Eigen::MatrixBase<Derived> & evidence, MultiDimNBatch<T,TSO> & out)
+	{
+		using TSA = typename A::layout_t;
+		using TSR = typename TSA::template dropmany<I...>;
+		static_assert(sizeof...(I) > 0,"at least one evidence dimension");
+		static_assert(details::samesizes<TSR,TSO>::value,"result requires the sizes of the factor without the evidence dimensions");
+		assert(evidence.cols() == sizeof...(I) && evidence.rows() == out.batch());
+		MULTIDIM_PROBE("gather", TSA, (details::kernelpathof<TSR,TSO>::value), (long)details::productseq<TSO>::value*out.batch(), (2L*details::productseq<TSO>::value*sizeof(T) + sizeof...(I)*sizeof(int))*out.batch());
+
+		const int steps[] = { TSA::template pick<I>::xstep... };
+		const Eigen::Matrix<int,Eigen::Dynamic,1> base = evidence.template cast<int>() * Eigen::Map<const Eigen::Matrix<int,sizeof...(I),1> >(steps);
+
+		const T * pa = factor.data();
+		T * po = out.data();
+		const int * pbase = base.data();
+		const int n = out.batch();
+		details::foreachoffset<TSR,TSO>([pa,po,pbase,n] (int oa, int oo)
+		{
+			const T * pf = pa + oa;
+			T * pc = po + (std::ptrdiff_t)oo*n;
+			for(int i = 0; i < n; i++)
+				pc[i] = pf[pbase[i]];
+		});
+	}
+
+	/// divides every instance by its sum
+	template <class T, class TS>
+	void normalize(MultiDimNBatch<T,TS> & a)
+	{
+		const typename MultiDimNBatch<T,TS>::batchvector_t s = sum(a);
+
+		// the probe covers only the division pass, sum has its own
+		MULTIDIM_PROBE("batch_normalize", TS, details::kernelpathof<TS>::value, (long)details::productseq<TS>::value*a.batch(), (2L*details::productseq<TS>::value+1)*a.batch()*sizeof(T));
+		details::foreachoffset<TS>([&a,&s] (int oa) { a.col(oa).array() /= s; });
+	}
+
+	/// divides every slice along dim of every instance by its sum
+	template <int dim, class T, class TS>
+	void normalize(MultiDimNBatch<T,TS> & a)
+	{
+		using TSS = details::densemake<typename TS::template drop<dim> >;
+		MultiDimNBatch<T,TSS> sums(a.batch());
+		sumout<dim>(a, sums);
+
+		// the probe covers only the division pass, sumout has its own
+		MULTIDIM_PROBE("batch_normalizedim", TS, (details::kernelpathof<TS,details::dropexpandmake<TSS,dim,TS> >::value), (long)details::productseq<TS>::value*a.batch(), (2L*details::productseq<TS>::value+details::productseq<TSS>::value)*a.batch()*sizeof(T));
+		details::foreachoffset<TS,details::dropexpandmake<TSS,dim,TS> >([&a,&sums] (int oa, int os) { a.col(oa).array() /= sums.col(os).array(); });
+	}
+}
@@ -0,0 +1,209 @@
+/**
+ * Multidimensional Static Matrix C++11
+ * Copyright Emanuele Ruffaldi (2015) at Scuola Superiore Sant'Anna Pisa
+ *
+ * Incremental marginals: cached reduction of a MultiDimN when only slices change
+ *
+ * Under Apache License
+ */
+#pragma once
+#include <bitset>
+#include "multidim_ops.hpp"
+
+namespace multidim
+{
+	/**
+	 * Marginal over dimension keep of a MultiDimN that is updated one slice along dimension upd at a
+	 * time. The partial marginal of every slice is kept, so that a refresh re-reduces only the dirty
+	 * slices and applies their difference to the marginal: the cost scales with the slice size plus
+	 * Nkeep. Every Nupd slice refreshes the marginal is summed again from the partials, which bounds
+	 * the rounding drift at an amortized cost of Nkeep per slice.
+	 *
+	 * When upd == keep every slice is a single entry of the marginal, which is then stored directly
+	 *
+	 * Views returned by slice() or block() keep their slices dirty while they are alive, so writes
+	 * through a held view are seen by the next refresh. They must not outlive the cache. Writes done
+	 * directly on the tensor require markdirty() or rebuild()
+	 */
+	template <class T, class TS, int upd, int keep>
+	class MultiDimNCachedSum
+	{
+	public:
+		static constexpr int Nupd = TS::template pick<upd>::xsize;
+		static constexpr int Nkeep = TS::template pick<keep>::xsize;
+		using tensor_t = MultiDimN<T,TS>;
+		using slicelayout_t = typename TS::template drop<upd>;
+		using marginal_t = MultiDimNRow<T,Nkeep>;
+
+		/// view V over count slices from first that keeps them dirty until destroyed
+		template <class V>
+		class pinned: public V
+		{
+		public:
+			pinned(MultiDimNCachedSum * owner, int first, int count, V v): V(v), owner_(owner), first_(first), count_(count)
+			{
+				owner_->pin(first_, count_, 1);
+			}
+
+			pinned(const pinned & o): V(o), owner_(o.owner_), first_(o.first_), count_(o.count_)
+			{
+				owner_->pin(first_, count_, 1);
+			}
+
+			~pinned()
+			{
+				owner_->pin(first_, count_, -1);
+			}
+
+			pinned & operator = (const pinned &) = delete;
+
+		private:
+			MultiDimNCachedSum * owner_;
+			int first_;
+			int count_;
+		};
+
+		using sliceview_t = pinned<MultiDimNView<T,slicelayout_t> >;
+
+		template <int newsize>
+		using blockview_t = pinned<decltype(std::declval<tensor_t&>().template limit1block<upd,newsize>(0))>;
+
+		explicit MultiDimNCachedSum(tensor_t & x): x_(x), pins_(), stale_(0)
+		{
+			rebuild();
+		}
+
+		/// view of slice i along upd, dirty while alive
+		sliceview_t slice(int i)
+		{
+			return sliceview_t(this, i, 1, x_.template limit1<upd>(i));
+		}
+
+		/// view of newsize slices along upd starting from i1, all dirty while alive
+		template <int newsize>
+		blockview_t<newsize> block(int i1)
+		{
+			return blockview_t<newsize>(this, i1, newsize, x_.template limit1block<upd,newsize>(i1));
+		}
+
+		void markdirty(int i) { dirty_.set(i); }
+
+		bool dirty() const { return dirty_.any(); }
+
+		/// re-reduces the dirty slices and applies their delta to the marginal, slices of live views stay dirty
+		void refresh()
+		{
+			if(dirty_.none())
+				return;
+			MULTIDIM_PROBE("cache_refresh", TS, "incremental", (long)dirty_.count()*details::productseq<slicelayout_t>::value, 
+				(long)dirty_.count()*(details::productseq<slicelayout_t>::value + (upd == keep ? 1 : 3*Nkeep))*sizeof(T));
+			for(int i = 0; i < Nupd; i++)
+				if(dirty_.test(i))
+					update(i, boolholder<upd == keep>());
+			repin();
+		}
+
+		/// the marginal, refreshed if needed
+		const marginal_t & marginal()
+		{
+			refresh();
+			return marginal_;
+		}
+
+		/// full recomputation
+		void rebuild()
+		{
+			MULTIDIM_PROBE("cache_rebuild", TS, "full", details::productseq<TS>::value, (details::productseq<TS>::value + (upd == keep ? 0 : 2*Nupd*Nkeep))*sizeof(T));
+			for(int i = 0; i < Nupd; i++)
+				reduce(i, boolholder<upd == keep>());
+			resum(boolholder<upd == keep>());
+			repin();
+		}
+
+	private:
+		/// adds d to the pin count of the count slices from first, marking them dirty
+		void pin(int first, int count, int d)
+		{
+			for(int i = first; i < first+count; i++)
+			{
+				pins_[i] += d;
+				dirty_.set(i);
+			}
+		}
+
+		/// only the slices of live views stay dirty
+		void repin()
+		{
+			dirty_.reset();
+			for(int i = 0; i < Nupd; i++)
+				if(pins_[i] > 0)
+					dirty_.set(i);
+		}
+
+		/// marginal from the partials, exact
+		void resum(std::false_type)
+		{
+			const T * pp = partial_.data();
+			T * pm = marginal_.data();
+			for(int j = 0; j < Nkeep; j++)
+				pm[j] = T(0);
+			for(int i = 0; i < Nupd; i++)
+				for(int j = 0; j < Nkeep; j++)
+					pm[j] += pp[i*Nkeep+j];
+			stale_ = 0;
+		}
+
+		void resum(std::true_type) {}
+
+		/// replaces the partial of slice i in the marginal
+		void update(int i, std::false_type)
+		{
+			T * pm = marginal_.data();
+			const T * pp = partial_.data() + i*Nkeep;
+			for(int j = 0; j < Nkeep; j++)
+				pm[j] -= pp[j];
+			reduce(i, std::false_type());
+			for(int j = 0; j < Nkeep; j++)
+				pm[j] += pp[j];
+			if(++stale_ >= Nupd)
+				resum(std::false_type());
+		}
+
+		void update(int i, std::true_type)
+		{
+			reduce(i, std::true_type());
+		}
+
+		/// partial marginal of slice i into row i of partial_
+		void reduce(int i, std::false_type)
+		{
+			using rowlayout_t = typename marginal_t::layout_t;
+			constexpr int keepd = keep < upd ? keep : keep-1;
+
+			const T * ps = x_.data() + i*TS::template pick<upd>::xstep;
+			T * pp = partial_.data() + i*Nkeep;
+			for(int j = 0; j < Nkeep; j++)
+				pp[j] = T(0);
+			details::foreachoffset<slicelayout_t,details::expandmake<rowlayout_t,slicelayout_t,keepd> >([ps,pp] (int os, int op) { pp[op] += ps[os]; });
+		}
+
+		/// keep == upd: slice i is entry i of the marginal
+		void reduce(int i, std::true_type)
+		{
+			const T * ps = x_.data() + i*TS::template pick<upd>::xstep;
+			T s = 0;
+			details::foreachoffset<slicelayout_t>([ps,&s] (int os) { s += ps[os]; });
+			marginal_.data()[i] = s;
+		}
+
+		/// row i is the partial marginal of slice i, unused when upd == keep
+		using partial_t = typename std::conditional<upd == keep, MultiDimNRow<T,1>, MultiDimNRow<T,Nupd,Nkeep> >::type;
+
+		tensor_t & x_;
+		partial_t partial_;
+		marginal_t marginal_;
+		std::bitset<Nupd> dirty_;
+		int pins_[Nupd];
+		int stale_;
+	};
+}
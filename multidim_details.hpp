@@ -11,6 +11,11 @@
 #pragma once
 #include <type_traits>
 
+/// layouts with less than this number of elements get fully unrolled kernels
+#ifndef MULTIDIM_UNROLL_THRESHOLD
+#define MULTIDIM_UNROLL_THRESHOLD 64
+#endif
+
 namespace multidim
 {
   // for type-values
@@ -280,6 +285,40 @@ namespace details
 
   }
 
+  namespace dropsome_details
+  {
+
+  template <int j, int current, int...I>
+  struct contains;
+
+  template <int j, int current>
+  struct contains<j,current> : std::false_type {};
+
+  template <int j, int current, int i, int...I>
+  struct contains<j,current,i,I...> : std::conditional<i == j, std::true_type, contains<j,current,I...> >::type {};
+
+  /// walks TS keeping in OTS the entries whose index (current) is not listed in I...
+  template <class OTS, int current, class TS, int...I>
+  struct dropper;
+
+  template <class...Out, int current, int...I>
+  struct dropper<type_sequence<Out...>, current, type_sequence<>, I...>
+    : type_holder<type_sequence<Out...> >
+    {
+    };
+
+  template <class...Out, int current, class x, class...Past, int...I>
+  struct dropper<type_sequence<Out...>, current, type_sequence<x,Past...>, I...>
+    : dropper<typename std::conditional<contains<current,0,I...>::value, type_sequence<Out...>, type_sequence<Out...,x> >::type, current+1, type_sequence<Past...>, I...>
+    {
+    };
+
+  }
+
+  /// drops all the indices I... from sequence TS
+  template <class TS, int...I>
+  using dropsomemake = typename dropsome_details::dropper<type_sequence<>, 0, TS, I...>::type;
+
   /// drops j-th from sequence I
   /// obtained by cascade inheritance templated
   template <template <class T> class Pred, class...Is>
@@ -360,6 +399,10 @@ template<class...I> struct type_sequence
   template <int index> 
   using drop = details::droppermake<index, I...>;
 
+  /// returns the list removing all the listed entries
+  template <int...index> 
+  using dropmany = details::dropsomemake<self, index...>;
+
   /// returns the list removing the index-th entry
   template <int index, class newtype> 
   using replacetype = details::replacetypemake<index, newtype, I...>;
@@ -431,6 +474,105 @@ template<class...I> struct type_sequence
       using type  = typename RowMajorStepper<N...>::type::template prepend<atype>;
     };
 
+    /// extent in elements of the memory addressed by the layout, including any padding
+    /// of the rows. For dense layouts this is the same as product
+    template<class... N> struct maxstepsize;
+
+    template<>
+    struct maxstepsize<> {
+        static constexpr  int value = 1;
+    };
+
+    template<int size, int step, class... N>
+    struct maxstepsize<sspair<size,step>, N...> {
+        static constexpr  int value = size*step > maxstepsize<N...>::value ? size*step : maxstepsize<N...>::value;
+    };
+
+    template<class T> struct maxstepsizeseqhelp;
+
+    template<class...N>
+    struct maxstepsizeseqhelp<type_sequence<N...> > {
+        static constexpr  int value = maxstepsize<N...>::value;
+    };    
+
+    template <class TS>
+    using storageseq = maxstepsizeseqhelp<TS>;
+
+    /// distance between first and last addressed element plus one: sum((size-1)*step)+1
+    /// A layout is dense (no holes, no padding) when span == product
+    template<class... N> struct span;
+
+    template<>
+    struct span<> {
+        static constexpr  int value = 1;
+    };
+
+    template<int size, int step, class... N>
+    struct span<sspair<size,step>, N...> {
+        static constexpr  int value = (size-1)*step + span<N...>::value;
+    };
+
+    template<class T> struct spanseqhelp;
+
+    template<class...N>
+    struct spanseqhelp<type_sequence<N...> > {
+        static constexpr  int value = span<N...>::value;
+    };    
+
+    template <class TS>
+    using spanseq = spanseqhelp<TS>;
+
+    /// rounds x up to a multiple of align
+    constexpr int roundup(int x, int align) { return ((x + align - 1)/align)*align; }
+
+    /// smallest step larger than 1, that is the pitch between the rows, 0 if none
+    template<class... N> struct minpitch;
+
+    template<>
+    struct minpitch<> {
+        static constexpr  int value = 0;
+    };
+
+    template<int size, int step, class... N>
+    struct minpitch<sspair<size,step>, N...> {
+        static constexpr  int value = step <= 1 || size == 1 ? minpitch<N...>::value : 
+          (minpitch<N...>::value == 0 || step < minpitch<N...>::value ? step : minpitch<N...>::value);
+    };
+
+    /// largest power of two dividing x
+    constexpr int pow2div(int x) { return x & -x; }
+
+    template<class T, int bytes> struct storagealignhelp;
+
+    template<class...N, int bytes>
+    struct storagealignhelp<type_sequence<N...>, bytes> {
+        static constexpr int pitch = minpitch<N...>::value*bytes;
+        static constexpr int value = pitch == 0 ? 1 : pow2div(pitch) > 64 ? 64 : pow2div(pitch);
+    };    
+
+    /// alignment in bytes that makes every row of TS start aligned as its pitch allows, up to a cache line
+    template <class TS, int bytes>
+    using storagealign = storagealignhelp<TS,bytes>;
+
+    /// row-major layout whose innermost rows are padded to a multiple of align elements
+    /// (e.g. SIMD width or cache line). next is the step that the enclosing dimension uses
+    template <int align, int... N>
+    struct RowMajorPaddedStepper;
+
+    template<int align, int x>
+    struct RowMajorPaddedStepper<align, x> {
+      using atype = sspair<x, 1>; 
+      using type  = type_sequence<atype>;
+      static constexpr int next = roundup(x, align);
+    };
+
+    template<int align, int x, int... N>
+    struct RowMajorPaddedStepper<align, x, N...> {
+      using atype = sspair<x, RowMajorPaddedStepper<align, N...>::next >; 
+      using type  = typename RowMajorPaddedStepper<align, N...>::type::template prepend<atype>;
+      static constexpr int next = atype::xstepsize;
+    };
+
     /// helps creating a sspair<size,step> with row-major layout
     template <typename above, int... N>
     struct ColMajorStepper;
@@ -455,6 +597,28 @@ template<class...I> struct type_sequence
     template <int...N>
     using colmajorstepper = typename ColMajorStepper<intholder<1>, N...>::type;
 
+    /// col-major counterpart of RowMajorPaddedStepper: the first dimension is the padded one
+    template <int align, int... N>
+    struct ColMajorPaddedStepper;
+
+    template<int align, int x>
+    struct ColMajorPaddedStepper<align, x> {
+      using type  = type_sequence<sspair<x, 1> >;
+    };
+
+    template<int align, int x, int... N>
+    struct ColMajorPaddedStepper<align, x, N...> {
+      using type  = typename ColMajorStepper<intholder<roundup(x, align)>,N...>::type::template prepend<sspair<x, 1> >;
+    };
+
+    /// building sspair<size,step> using rowmajor with the innermost rows padded to align elements
+    template <int align, int...N>
+    using rowmajorpaddedstepper = typename RowMajorPaddedStepper<align, N...>::type;
+
+    /// building sspair<size,step> using colmajor with the innermost columns padded to align elements
+    template <int align, int...N>
+    using colmajorpaddedstepper = typename ColMajorPaddedStepper<align, N...>::type;
+
     /// accessor 
     template<int current,class... N> struct daccessor;
 
@@ -501,6 +665,219 @@ template<class...I> struct type_sequence
       using type = typename sspairbyindex<TS...>::template byindex<I...>::type;
     };    
 
+    /// 0..n-1 as integer_sequence
+    template <int n>
+    struct makeseqhelp {
+      using type = typename makeseqhelp<n-1>::type::next;
+    };
+
+    template <>
+    struct makeseqhelp<0> {
+      using type = integer_sequence<int>;
+    };
+
+    template <int n>
+    using makeseq = typename makeseqhelp<n>::type;
+
+    /// sizes of a sspair sequence, used to compare layouts independently of the steps
+    template <class TS>
+    struct sizeshelp;
+
+    template <class...N>
+    struct sizeshelp<type_sequence<N...> > {
+      using type = integer_sequence<int, N::xsize...>;
+    };
+
+    template <class TSA, class TSB>
+    using samesizes = std::is_same<typename sizeshelp<TSA>::type, typename sizeshelp<TSB>::type>;
+
+    /// dense row-major layout with the same sizes of TS
+    template <class TS>
+    struct densehelp;
+
+    template <>
+    struct densehelp<type_sequence<> > {
+      using type = type_sequence<>;
+    };
+
+    template <class...N>
+    struct densehelp<type_sequence<N...> > {
+      using type = rowmajorstepper<N::xsize...>;
+    };
+
+    template <class TS>
+    using densemake = typename densehelp<TS>::type;
+
+    /// position of j in I... or -1
+    template <int j, int current, int...I>
+    struct indexof;
+
+    template <int j, int current>
+    struct indexof<j,current> {
+      static constexpr int value = -1;
+    };
+
+    template <int j, int current, int i, int...I>
+    struct indexof<j,current,i,I...> {
+      static constexpr int value = i == j ? current : indexof<j,current+1,I...>::value;
+    };
+
+    /// step of dimension pos of TSA, or 0 (replicated) when pos is -1
+    template <class TSA, int pos>
+    struct broadcaststep {
+      static constexpr int value = TSA::template pick<pos>::xstep;
+    };
+
+    template <class TSA>
+    struct broadcaststep<TSA,-1> {
+      static constexpr int value = 0;
+    };
+
+    /// layout of A seen with the sizes of B: dimension I_k of B is the k-th of A, the others have step 0
+    template <class TSA, class TSB, class J, int...I>
+    struct expander;
+
+    template <class TSA, class...B, int...J, int...I>
+    struct expander<TSA, type_sequence<B...>, integer_sequence<int,J...>, I...> {
+      using type = type_sequence< sspair<B::xsize, broadcaststep<TSA, indexof<J,0,I...>::value>::value>... >;
+    };
+
+    template <class TSA, class TSB, int...I>
+    using expandmake = typename expander<TSA,TSB,makeseq<TSB::size>,I...>::type;
+
+    /// compile time offset of the k-th logical element, counting in row-major order over the sizes
+    template <class TS>
+    struct linearoffset;
+
+    template <>
+    struct linearoffset<type_sequence<> > {
+      static constexpr int of(int) { return 0; }
+    };
+
+    template <class x, class...N>
+    struct linearoffset<type_sequence<x,N...> > {
+      static constexpr int of(int k) { return ((k / product<N...>::value) % x::xsize)*x::xstep + linearoffset<type_sequence<N...> >::of(k); }
+    };
+
+    template <class T, class...Rest>
+    struct firsthelp {
+      using type = T;
+    };
+
+    template <class...TS>
+    using first_t = typename firsthelp<TS...>::type;
+
+    /// expands a value once per type of a pack
+    template <class T>
+    constexpr int repeatfor(int i) { return i; }
+
+    /// code paths of the kernels, chosen at compile time from the layouts
+    /// padded is only taken by kernels over owned storage, see paddedlayout
+    enum class kernelpath { unrolled, dense, strided, padded };
+
+    /// index of the dimension with step 1 (and size > 1), -1 if none
+    template <class TS>
+    struct unitstepdim {
+      using A = typename daccessorseq<TS>::type;
+      static constexpr int find(int i) { return i >= TS::size ? -1 : (A::step(i) == 1 && A::size(i) > 1) ? i : find(i+1); }
+      static constexpr int value = find(0);
+    };
+
+    /// rows along the unit step dimension, pitch elements apart, that tile the storage without holes
+    /// other than the pitch-rowsize padding lanes at the end of every row (e.g. rowmajorpaddedstepper)
+    template <class TS>
+    struct paddedlayout {
+      static constexpr int row = unitstepdim<TS>::value;
+      static constexpr int rowsize = row < 0 ? 1 : daccessorseq<TS>::type::size(row);
+      static constexpr int rows = productseq<TS>::value / rowsize;
+      static constexpr int pitch = storageseq<TS>::value / rows;
+      static constexpr bool value = row >= 0 && pitch > rowsize && rows*pitch == storageseq<TS>::value && 
+        spanseq<TS>::value + pitch - rowsize == storageseq<TS>::value;
+    };
+
+    template <class...TS>
+    struct allsame;
+
+    template <class TS>
+    struct allsame<TS> : std::true_type {};
+
+    template <class TS, class...Rest>
+    struct allsame<TS,Rest...> : is_all<TS, Rest...> {};
+
+    /// all the layouts are expected to have the same sizes: the first one decides the element count
+    template <class TS, class...Rest>
+    struct kernelpathof {
+      static constexpr kernelpath value = 
+        productseq<TS>::value < MULTIDIM_UNROLL_THRESHOLD ? kernelpath::unrolled : 
+        (allsame<TS,Rest...>::value && spanseq<TS>::value == productseq<TS>::value) ? kernelpath::dense : kernelpath::strided;
+    };
+
+    /// fully unrolled: f is invoked with the offsets of element k in every layout, all constant.
+    /// A single pack expansion over the elements, so there is no call chain left for the inliner
+    template <class...TS>
+    struct unroller {
+      template <int k, class F>
+      static inline int one(F & f)
+      {
+        f(linearoffset<TS>::of(k)...);
+        return 0;
+      }
+
+      template <class F, int...K>
+      static inline void run(F & f, integer_sequence<int,K...>)
+      {
+        const int done[] = { 0, one<K>(f)... };
+        (void)done;
+      }
+    };
+
+    /// nested loops over dimension dim, the innermost loop runs with a compile time step
+    template <int dim, int ndims, class...TS>
+    struct strider {
+      template <class F, class...B>
+      static inline void run(F & f, B...bases)
+      {
+        for(int i = 0; i < first_t<TS...>::template pick<dim>::xsize; i++)
+          strider<dim+1,ndims,TS...>::run(f, (bases + i*TS::template pick<dim>::xstep)...);
+      }
+    };
+
+    template <int ndims, class...TS>
+    struct strider<ndims,ndims,TS...> {
+      template <class F, class...B>
+      static inline void run(F & f, B...bases)
+      {
+        f(bases...);
+      }
+    };
+
+    template <class...TS, class F>
+    inline void foreachoffset(std::integral_constant<kernelpath,kernelpath::unrolled>, F & f)
+    {
+      unroller<TS...>::run(f, makeseq<productseq<first_t<TS...> >::value>());
+    }
+
+    /// identical dense layouts: a flat loop, the order of the elements does not matter
+    template <class...TS, class F>
+    inline void foreachoffset(std::integral_constant<kernelpath,kernelpath::dense>, F & f)
+    {
+      for(int i = 0; i < productseq<first_t<TS...> >::value; i++)
+        f(repeatfor<TS>(i)...);
+    }
+
+    template <class...TS, class F>
+    inline void foreachoffset(std::integral_constant<kernelpath,kernelpath::strided>, F & f)
+    {
+      strider<0,first_t<TS...>::size,TS...>::run(f, repeatfor<TS>(0)...);
+    }
+
+    /// invokes f(offsets...) for every logical element, one offset per layout TS
+    /// the layouts must have the same sizes
+    template <class...TS, class F>
+    inline void foreachoffset(F && f)
+    {
+      foreachoffset<TS...>(std::integral_constant<kernelpath,kernelpathof<TS...>::value>(), f);
+    }
   }
 
 
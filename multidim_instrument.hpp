@@ -0,0 +1,219 @@
+/**
+ * Multidimensional Static Matrix C++11
+ * Copyright Emanuele Ruffaldi (2015) at Scuola Superiore Sant'Anna Pisa
+ *
+ * Opt-in instrumentation of the bulk operations, enabled by defining MULTIDIM_INSTRUMENT
+ *
+ * Every probed kernel adds to a global registry, keyed by kernel, layout signature (sizes:steps)
+ * and code path: calls, elements touched, estimated bytes moved and wall time. Reports are dumped
+ * as JSON or CSV. Without MULTIDIM_INSTRUMENT the probes expand to nothing.
+ *
+ * Every probe site resolves its slot of the registry once, then a call costs two clock reads and
+ * four relaxed atomic adds: no lock and no string is involved.
+ *
+ * Probe scopes never enclose other probed kernels: composite kernels such as normalize<dim> probe
+ * only their own pass, so every element and byte is counted once.
+ *
+ * Under Apache License
+ */
+#pragma once
+#include "multidim_details.hpp"
+
+#ifdef MULTIDIM_INSTRUMENT
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <tuple>
+
+namespace multidim
+{
+	namespace instrument
+	{
+		struct counters
+		{
+			long calls = 0;
+			long elements = 0;
+			long bytes = 0;
+			double seconds = 0;
+		};
+
+		/// live counters of one (kernel, layout, path), shared by its probe sites and never moved
+		struct slot
+		{
+			std::atomic<long> calls;
+			std::atomic<long> elements;
+			std::atomic<long> bytes;
+			std::atomic<long> nanoseconds;
+
+			slot(): calls(0), elements(0), bytes(0), nanoseconds(0) {}
+
+			void add(long e, long b, long ns)
+			{
+				calls.fetch_add(1, std::memory_order_relaxed);
+				elements.fetch_add(e, std::memory_order_relaxed);
+				bytes.fetch_add(b, std::memory_order_relaxed);
+				nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+			}
+
+			void reset()
+			{
+				calls = 0;
+				elements = 0;
+				bytes = 0;
+				nanoseconds = 0;
+			}
+
+			counters snapshot() const
+			{
+				counters c;
+				c.calls = calls.load(std::memory_order_relaxed);
+				c.elements = elements.load(std::memory_order_relaxed);
+				c.bytes = bytes.load(std::memory_order_relaxed);
+				c.seconds = nanoseconds.load(std::memory_order_relaxed)*1e-9;
+				return c;
+			}
+		};
+
+		/// aggregated counters, thread safe: the lock is taken only to resolve slots and for reports
+		class registry
+		{
+		public:
+			using key_t = std::tuple<std::string,std::string,std::string>; // kernel, layout, path
+
+			static registry & get()
+			{
+				static registry r;
+				return r;
+			}
+
+			/// the slot of kernel, layout and path, created on first use
+			slot & find(const char * kernel, const std::string & layout, const char * path)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				std::unique_ptr<slot> & s = slots_[key_t(kernel,layout,path)];
+				if(!s)
+					s.reset(new slot());
+				return *s;
+			}
+
+			/// zeroes the counters, slots stay valid
+			void reset()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				for(auto & x: slots_)
+					x.second->reset();
+			}
+
+			/// snapshot of the slots that have been called
+			std::map<key_t,counters> entries() const
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				std::map<key_t,counters> e;
+				for(auto & x: slots_)
+				{
+					const counters c = x.second->snapshot();
+					if(c.calls > 0)
+						e[x.first] = c;
+				}
+				return e;
+			}
+
+			void dumpjson(std::ostream & os) const
+			{
+				const std::map<key_t,counters> e = entries();
+				os << "[";
+				bool first = true;
+				for(auto & x: e)
+				{
+					os << (first ? "\n" : ",\n");
+					os << " {\"kernel\":\"" << std::get<0>(x.first) << "\",\"layout\":\"" << std::get<1>(x.first) << "\",\"path\":\"" << std::get<2>(x.first)
+					   << "\",\"calls\":" << x.second.calls << ",\"elements\":" << x.second.elements << ",\"bytes\":" << x.second.bytes
+					   << ",\"seconds\":" << x.second.seconds << ",\"GBps\":" << gbps(x.second) << "}";
+					first = false;
+				}
+				os << "\n]\n";
+			}
+
+			void dumpcsv(std::ostream & os) const
+			{
+				const std::map<key_t,counters> e = entries();
+				os << "kernel,layout,path,calls,elements,bytes,seconds,GBps\n";
+				for(auto & x: e)
+				{
+					os << std::get<0>(x.first) << ",\"" << std::get<1>(x.first) << "\"," << std::get<2>(x.first) << ","
+					   << x.second.calls << "," << x.second.elements << "," << x.second.bytes << "," << x.second.seconds << "," << gbps(x.second) << "\n";
+				}
+			}
+
+		private:
+			static double gbps(const counters & c) { return c.seconds > 0 ? c.bytes/c.seconds*1e-9 : 0; }
+
+			mutable std::mutex mutex_;
+			std::map<key_t,std::unique_ptr<slot> > slots_;
+		};
+
+		/// sizes and steps of a layout, e.g. "5x6x8:336,56,1", built once per layout
+		template <class TS>
+		const std::string & signature()
+		{
+			static const std::string s = [] () {
+				using A = typename details::daccessorseq<TS>::type;
+				std::ostringstream os;
+				for(int i = 0; i < TS::size; i++)
+					os << (i ? "x" : "") << A::size(i);
+				os << ":";
+				for(int i = 0; i < TS::size; i++)
+					os << (i ? "," : "") << A::step(i);
+				return os.str();
+			}();
+			return s;
+		}
+
+		inline const char * pathname(details::kernelpath p)
+		{
+			return p == details::kernelpath::unrolled ? "unrolled" : p == details::kernelpath::dense ? "dense" : p == details::kernelpath::padded ? "padded" : "strided";
+		}
+
+		inline const char * pathname(const char * p)
+		{
+			return p;
+		}
+
+		/// times its scope and adds to the slot when destroyed
+		class probe
+		{
+		public:
+			probe(slot & s, long elements, long bytes):
+				slot_(s), elements_(elements), bytes_(bytes), start_(std::chrono::steady_clock::now())
+			{
+			}
+
+			~probe()
+			{
+				const long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+				slot_.add(elements_, bytes_, ns);
+			}
+
+		private:
+			slot & slot_;
+			long elements_;
+			long bytes_;
+			std::chrono::steady_clock::time_point start_;
+		};
+	}
+}
+
+/// probes the enclosing scope: kernel name, layout TS, path (kernelpath or string), elements and bytes.
+/// kernel, TS and path are fixed for every probe site of a template instance, so its slot is resolved once
+#define MULTIDIM_PROBE(kernel, TS, path, elements, bytes) \
+	static multidim::instrument::slot & multidim_slot_ = multidim::instrument::registry::get().find(kernel, multidim::instrument::signature<TS>(), \
+		multidim::instrument::pathname(path)); \
+	multidim::instrument::probe multidim_probe_(multidim_slot_, elements, bytes)
+#else
+#define MULTIDIM_PROBE(kernel, TS, path, elements, bytes)
+#endif
@@ -0,0 +1,162 @@
+/**
+ * Multidimensional Static Matrix C++11
+ * Copyright Emanuele Ruffaldi (2015) at Scuola Superiore Sant'Anna Pisa
+ *
+ * Parameter learning support: sufficient statistics (counts) accumulation
+ *
+ * Records are converted to offsets with the compile time steps (one matrix-vector product per
+ * block of records) and scattered into the count tensor. Threads count into private tables that
+ * are merged by a tree reduction. When the private tables would be too large each thread owns
+ * a range of the table instead: offsets are computed once in parallel over chunks of records and
+ * bucketed by owner, then every owner adds its buckets. C++11 has no atomic add for floating
+ * point types.
+ *
+ * Under Apache License
+ */
+#pragma once
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "multidim_ops.hpp"
+
+/// default maximum number of elements of all the private tables together
+#ifndef MULTIDIM_COUNTS_PRIVATE_LIMIT
+#define MULTIDIM_COUNTS_PRIVATE_LIMIT (1 << 22)
+#endif
+
+/// records processed per thread at least, and per offset computation block
+#ifndef MULTIDIM_COUNTS_BLOCK
+#define MULTIDIM_COUNTS_BLOCK 4096
+#endif
+
+namespace multidim
+{
+	namespace details
+	{
+		/// runs f(t) for t in 0..n-1, each in its own thread except the first one
+		template <class F>
+		void parallelfor(int n, F f)
+		{
+			std::vector<std::thread> workers;
+			for(int t = 1; t < n; t++)
+				workers.push_back(std::thread(f, t));
+			f(0);
+			for(auto & w: workers)
+				w.join();
+		}
+
+		/// visits the memory offsets of records [begin,end) in blocks, calling f(record, offset)
+		template <class TS, int...I, class Derived, class F>
+		void foreachrecord(const Eigen::MatrixBase<Derived> & records, Eigen::Index begin, Eigen::Index end, F & f)
+		{
+			const int steps[] = { TS::template pick<I>::xstep... };
+			const Eigen::Map<const Eigen::Matrix<int,sizeof...(I),1> > stepsv(steps);
+			Eigen::Matrix<int,Eigen::Dynamic,1> offsets;
+			for(Eigen::Index b = begin; b < end; b += MULTIDIM_COUNTS_BLOCK)
+			{
+				const Eigen::Index n = std::min(end-b, (Eigen::Index)MULTIDIM_COUNTS_BLOCK);
+				offsets.noalias() = records.middleRows(b,n).template cast<int>() * stepsv;
+				for(Eigen::Index i = 0; i < n; i++)
+					f(b+i, offsets[i]);
+			}
+		}
+
+		template <int...I, class A, class Derived, class W>
+		void accumulate_counts(A && tensor, const Eigen::MatrixBase<Derived> & records, W weight, int nthreads, long privatelimit)
+		{
+			using T = valueof<A>;
+			using TS = layoutof<A>;
+			static_assert(sizeof...(I) == TS::size,"every dimension of the table requires a column of the records");
+			assert(records.cols() == sizeof...(I));
+
+			const Eigen::Index N = records.rows();
+			const int span = spanseq<TS>::value;
+			if(nthreads <= 0)
+				nthreads = std::max(1,(int)std::thread::hardware_concurrency());
+			nthreads = (int)std::max((Eigen::Index)1,std::min((Eigen::Index)nthreads, N / MULTIDIM_COUNTS_BLOCK));
+
+			T * pt = tensor.data();
+			if(nthreads == 1)
+			{
+				MULTIDIM_PROBE("accumulate_counts", TS, "serial", N, (long)N*(sizeof...(I)*sizeof(int) + 2*sizeof(T)));
+				auto f = [pt,&weight] (Eigen::Index n, int o) { pt[o] += weight(n); };
+				foreachrecord<TS,I...>(records, 0, N, f);
+			}
+			else if((long)nthreads*span <= privatelimit)
+			{
+				MULTIDIM_PROBE("accumulate_counts", TS, "private", N, (long)N*(sizeof...(I)*sizeof(int) + 2*sizeof(T)) + 2L*nthreads*span*sizeof(T));
+				using table_t = Eigen::Matrix<T,Eigen::Dynamic,1>;
+				std::vector<table_t> tables(nthreads, table_t::Zero(span));
+				parallelfor(nthreads, [&] (int t)
+				{
+					T * pp = tables[t].data();
+					auto f = [pp,&weight] (Eigen::Index n, int o) { pp[o] += weight(n); };
+					foreachrecord<TS,I...>(records, N*t/nthreads, N*(t+1)/nthreads, f);
+				});
+				// tree reduction: at every level table t takes t+stride
+				for(int stride = 1; stride < nthreads; stride *= 2)
+				{
+					const int pairs = (nthreads - stride + 2*stride - 1) / (2*stride);
+					parallelfor(pairs, [&] (int k) { tables[2*stride*k] += tables[2*stride*k+stride]; });
+				}
+				const T * pp = tables[0].data();
+				foreachoffset<TS>([pt,pp] (int o) { pt[o] += pp[o]; });
+			}
+			else
+			{
+				struct item
+				{
+					int offset;
+					T weight;
+				};
+				MULTIDIM_PROBE("accumulate_counts", TS, "owner", N, (long)N*(sizeof...(I)*sizeof(int) + 2*sizeof(T) + 2*sizeof(item)));
+				// buckets[t*nthreads+u]: items produced by thread t for the owner u of the range [span*u/nthreads,span*(u+1)/nthreads)
+				std::vector<std::vector<item> > buckets(nthreads*nthreads);
+				const Eigen::Index chunk = (Eigen::Index)nthreads*MULTIDIM_COUNTS_BLOCK*16;
+				for(Eigen::Index c = 0; c < N; c += chunk)
+				{
+					const Eigen::Index n = std::min(N-c, chunk);
+					parallelfor(nthreads, [&] (int t)
+					{
+						std::vector<item> * mine = &buckets[t*nthreads];
+						for(int u = 0; u < nthreads; u++)
+							mine[u].clear();
+						const int owners = nthreads;
+						auto f = [mine,owners,span,&weight] (Eigen::Index r, int o) { mine[(long)o*owners/span].push_back(item{o, weight(r)}); };
+						foreachrecord<TS,I...>(records, c + n*t/nthreads, c + n*(t+1)/nthreads, f);
+					});
+					parallelfor(nthreads, [&] (int u)
+					{
+						for(int t = 0; t < nthreads; t++)
+							for(const item & x: buckets[t*nthreads+u])
+								pt[x.offset] += x.weight;
+					});
+				}
+			}
+		}
+	}
+
+	/**
+	 * Adds weights(n) to the cell of tensor selected by records(n,:), where column k of records is
+	 * the state of dimension I_k of the tensor. Weights are the expected counts of EM
+	 *
+	 * nthreads <= 0 uses all the hardware threads. Private tables are used while their elements
+	 * together stay within privatelimit, otherwise threads own ranges of the table
+	 */
+	template <int...I, class A, class Derived, class WDerived>
+	void accumulate_counts(A && tensor, const Eigen::MatrixBase<Derived> & records, const Eigen::MatrixBase<WDerived> & weights, int nthreads = 0, 
+		long privatelimit = MULTIDIM_COUNTS_PRIVATE_LIMIT)
+	{
+		using T = details::valueof<A>;
+		assert(weights.size() == records.rows());
+		details::accumulate_counts<I...>(tensor, records, [&weights] (Eigen::Index n) { return T(weights(n)); }, nthreads, privatelimit);
+	}
+
+	/// counts with unit weights
+	template <int...I, class A, class Derived>
+	void accumulate_counts(A && tensor, const Eigen::MatrixBase<Derived> & records, int nthreads = 0, long privatelimit = MULTIDIM_COUNTS_PRIVATE_LIMIT)
+	{
+		using T = details::valueof<A>;
+		details::accumulate_counts<I...>(tensor, records, [] (Eigen::Index) { return T(1); }, nthreads, privatelimit);
+	}
+}
@@ -0,0 +1,217 @@
+/**
+ * Multidimensional Static Matrix C++11
+ * Copyright Emanuele Ruffaldi (2015) at Scuola Superiore Sant'Anna Pisa
+ *
+ * Kernels over MultiDimN and MultiDimNView: element-wise, reduction, broadcast and normalization
+ *
+ * Every kernel iterates through details::foreachoffset that picks, at compile time:
+ * - unrolled: below MULTIDIM_UNROLL_THRESHOLD elements, no loops and constant offsets
+ * - dense: identical contiguous layouts, a flat loop
+ * - strided: nested loops following the steps
+ * Kernels over an owned MultiDimN with a padded layout instead run full rows of pitch lanes over the
+ * whole storage, padding lanes included (written but ignored, or masked in reductions)
+ *
+ * Under Apache License
+ */
+#pragma once
+#include "multidim_static.hpp"
+
+namespace multidim
+{
+	namespace details
+	{
+		/// layout and value type of a MultiDimN or MultiDimNView, also when A is a reference
+		template <class A>
+		using layoutof = typename std::decay<A>::type::layout_t;
+
+		template <class A>
+		using valueof = typename std::decay<A>::type::value_t;
+
+		/// layout of B seen with the sizes of A when B is A without the dimension dim (step 0 along dim)
+		template <class TSB, int dim, class TSA, class J>
+		struct dropexpander;
+
+		template <class TSB, int dim, class...A, int...J>
+		struct dropexpander<TSB, dim, type_sequence<A...>, integer_sequence<int,J...> > {
+			using type = type_sequence< sspair<A::xsize, broadcaststep<TSB, (J < dim ? J : (J == dim ? -1 : J-1))>::value>... >;
+		};
+
+		template <class TSB, int dim, class TSA>
+		using dropexpandmake = typename dropexpander<TSB,dim,TSA,makeseq<TSA::size> >::type;
+
+		/// operands all owned MultiDimN with the same padded layout
+		template <class A, class...B>
+		struct ownerpadded : boolholder<isowner<typename std::decay<A>::type>::value && paddedlayout<layoutof<A> >::value && 
+			allsame<layoutof<A>,layoutof<B>...>::value && allsame<boolholder<true>,boolholder<isowner<typename std::decay<B>::type>::value>...>::value> {};
+
+		template <bool padded, class...TS>
+		struct ownerpathof {
+			static constexpr kernelpath value = padded ? kernelpath::padded : kernelpathof<TS...>::value;
+		};
+
+		/// elements a kernel moves: the whole storage on the padded path, the logical elements otherwise
+		template <bool padded, class TS>
+		struct touchedseq {
+			static constexpr int value = padded ? storageseq<TS>::value : productseq<TS>::value;
+		};
+
+		template <class T, class TS, class F>
+		void applyrun(T * pa, F & f, std::true_type)
+		{
+			for(int i = 0; i < storageseq<TS>::value; i++)
+				pa[i] = f(pa[i]);
+		}
+
+		template <class T, class TS, class F>
+		void applyrun(T * pa, F & f, std::false_type)
+		{
+			foreachoffset<TS>([pa,&f] (int oa) { pa[oa] = f(pa[oa]); });
+		}
+
+		template <class T, class TSA, class TSB, class F>
+		void apply2run(T * pa, const T * pb, F & f, std::true_type)
+		{
+			for(int i = 0; i < storageseq<TSA>::value; i++)
+				pa[i] = f(pa[i],pb[i]);
+		}
+
+		template <class T, class TSA, class TSB, class F>
+		void apply2run(T * pa, const T * pb, F & f, std::false_type)
+		{
+			foreachoffset<TSA,TSB>([pa,pb,&f] (int oa, int ob) { pa[oa] = f(pa[oa],pb[ob]); });
+		}
+
+		/// one accumulator per lane, so the inner loop runs full width, then the padding lanes are dropped
+		template <class T, class TS>
+		T sumrun(const T * pa, std::true_type)
+		{
+			using P = paddedlayout<TS>;
+			T acc[P::pitch] = {};
+			for(int r = 0; r < P::rows; r++)
+				for(int l = 0; l < P::pitch; l++)
+					acc[l] += pa[r*P::pitch+l];
+			T s = 0;
+			for(int l = 0; l < P::rowsize; l++)
+				s += acc[l];
+			return s;
+		}
+
+		template <class T, class TS>
+		T sumrun(const T * pa, std::false_type)
+		{
+			T s = 0;
+			foreachoffset<TS>([pa,&s] (int oa) { s += pa[oa]; });
+			return s;
+		}
+	}
+
+	/// a = f(a) for every element
+	template <class A, class F>
+	void apply(A && a, F f)
+	{
+		using TSA = details::layoutof<A>;
+		using padded = details::ownerpadded<A>;
+		MULTIDIM_PROBE("apply", TSA, (details::ownerpathof<padded::value,TSA>::value), (details::touchedseq<padded::value,TSA>::value), 2*(details::touchedseq<padded::value,TSA>::value)*sizeof(*a.data()));
+
+		details::applyrun<details::valueof<A>,TSA>(a.data(), f, padded());
+	}
+
+	/// a = f(a,b) element-wise, a and b need the same sizes but not the same steps
+	template <class A, class B, class F>
+	void apply2(A && a, const B & b, F f)
+	{
+		using TSA = details::layoutof<A>;
+		using TSB = details::layoutof<B>;
+		static_assert(details::samesizes<TSA,TSB>::value,"operands require the same sizes");
+		using padded = details::ownerpadded<A,B>;
+		MULTIDIM_PROBE("apply2", TSA, (details::ownerpathof<padded::value,TSA,TSB>::value), (details::touchedseq<padded::value,TSA>::value), 3*(details::touchedseq<padded::value,TSA>::value)*sizeof(*a.data()));
+
+		details::apply2run<details::valueof<A>,TSA,TSB>(a.data(), b.data(), f, padded());
+	}
+
+	/// a = b element-wise, e.g. for changing layout
+	template <class A, class B>
+	void assign(A && a, const B & b)
+	{
+		using T = details::valueof<A>;
+		apply2(a, b, [] (T, T y) { return y; });
+	}
+
+	/// a *= b element-wise
+	template <class A, class B>
+	void multiply(A && a, const B & b)
+	{
+		using T = details::valueof<A>;
+		apply2(a, b, [] (T x, T y) { return x*y; });
+	}
+
+	/// sum of all the elements
+	template <class A>
+	auto sum(const A & a) -> typename A::value_t
+	{
+		using T = typename A::value_t;
+		using padded = details::ownerpadded<A>;
+		MULTIDIM_PROBE("sum", typename A::layout_t, (details::ownerpathof<padded::value,typename A::layout_t>::value), (details::touchedseq<padded::value,typename A::layout_t>::value), 
+			(details::touchedseq<padded::value,typename A::layout_t>::value)*sizeof(T));
+
+		return details::sumrun<T,typename A::layout_t>(a.data(), padded());
+	}
+
+	/// b = sum of a along dim, where b has the sizes of a without dim
+	template <int dim, class A, class B>
+	void sumout(const A & a, B && b)
+	{
+		using T = typename A::value_t;
+		using TSA = typename A::layout_t;
+		using TSB = details::layoutof<B>;
+		static_assert(details::samesizes<typename TSA::template drop<dim>,TSB>::value,"result requires the sizes of the source without dim");
+		MULTIDIM_PROBE("sumout", TSA, (details::kernelpathof<TSA,details::dropexpandmake<TSB,dim,TSA> >::value), details::productseq<TSA>::value, (details::productseq<TSA>::value+2*details::productseq<TSB>::value)*sizeof(T));
+
+		const T * pa = a.data();
+		T * pb = b.data();
+		details::foreachoffset<TSB>([pb] (int ob) { pb[ob] = T(0); });
+		details::foreachoffset<TSA,details::dropexpandmake<TSB,dim,TSA> >([pa,pb] (int oa, int ob) { pb[ob] += pa[oa]; });
+	}
+
+	/// b = a replicated over the dimensions of b not listed in I...: dimension k of a is dimension I_k of b
+	template <int...I, class A, class B>
+	void expand(const A & a, B && b)
+	{
+		using T = typename A::value_t;
+		using TSA = typename A::layout_t;
+		using TSB = details::layoutof<B>;
+		static_assert(sizeof...(I) == TSA::size,"one index of the destination for every dimension of the source");
+		static_assert(details::samesizes<TSA,type_sequence<typename TSB::template pick<I>...> >::value,"common dimensions require the same sizes");
+		MULTIDIM_PROBE("expand", TSB, (details::kernelpathof<TSB,details::expandmake<TSA,TSB,I...> >::value), details::productseq<TSB>::value, (details::productseq<TSA>::value+details::productseq<TSB>::value)*sizeof(T));
+
+		const T * pa = a.data();
+		T * pb = b.data();
+		details::foreachoffset<TSB,details::expandmake<TSA,TSB,I...> >([pa,pb] (int ob, int oa) { pb[ob] = pa[oa]; });
+	}
+
+	/// divides by the sum of all the elements
+	template <class A>
+	void normalize(A && a)
+	{
+		using T = details::valueof<A>;
+		T s = sum(a);
+		apply(a, [s] (T x) { return x/s; });
+	}
+
+	/// divides every slice along dim by its sum, as for a conditional table P(dim|others)
+	template <int dim, class A>
+	void normalize(A && a)
+	{
+		using T = details::valueof<A>;
+		using TSA = details::layoutof<A>;
+		using TSS = details::densemake<typename TSA::template drop<dim> >;
+		MultiDimN<T,TSS> sums;
+		sumout<dim>(a, sums);
+
+		// the probe covers only the division pass, sumout has its own
+		MULTIDIM_PROBE("normalizedim", TSA, (details::kernelpathof<TSA,details::dropexpandmake<TSS,dim,TSA> >::value), details::productseq<TSA>::value, (2*details::productseq<TSA>::value+details::productseq<TSS>::value)*sizeof(T));
+		T * pa = a.data();
+		const T * ps = sums.data();
+		details::foreachoffset<TSA,details::dropexpandmake<TSS,dim,TSA> >([pa,ps] (int oa, int os) { pa[oa] /= ps[os]; });
+	}
+}
@@ -0,0 +1,154 @@
+/**
+ * Multidimensional Static Matrix C++11
+ * Copyright Emanuele Ruffaldi (2015) at Scuola Superiore Sant'Anna Pisa
+ *
+ * Categorical sampling from the slices of a factor via Walker alias tables
+ *
+ * Every configuration of the parents (all the dimensions except child) gets an alias table over the
+ * states of child. Tables are stored contiguously in parent-major order, so that a draw touches a
+ * single block of child-size entries. Draws are O(1) from a single uniform number.
+ *
+ * Under Apache License
+ */
+#pragma once
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "multidim_ops.hpp"
+
+namespace multidim
+{
+	/**
+	 * Sampler of dimension child of a TS-shaped factor, conditioned on the other dimensions.
+	 * Slices need not be normalized
+	 */
+	template <class T, class TS, int child>
+	class MultiDimNSampler
+	{
+	public:
+		/// dense row-major layout of the parent configurations
+		using parents_t = details::densemake<typename TS::template drop<child> >;
+		static constexpr int K = TS::template pick<child>::xsize;
+		static constexpr int Nparents = details::productseq<parents_t>::value;
+
+		/// one alias table entry
+		struct entry
+		{
+			T prob;
+			int alias;
+		};
+
+		template <class A>
+		explicit MultiDimNSampler(const A & factor): table_(Nparents*K)
+		{
+			update(factor);
+		}
+
+		/// rebuilds all the tables from factor (Vose's method)
+		template <class A>
+		void update(const A & factor)
+		{
+			static_assert(details::samesizes<TS,typename A::layout_t>::value,"factor requires the sizes of the sampler");
+			using TSA = typename A::layout_t;
+			const int childstep = TSA::template pick<child>::xstep;
+			MULTIDIM_PROBE("sampler_update", TSA, "alias", details::productseq<TSA>::value, details::productseq<TSA>::value*(sizeof(T)+sizeof(entry)));
+			const T * pa = factor.data();
+			entry * pt = table_.data();
+			details::foreachoffset<parents_t,typename TSA::template drop<child> >([pa,pt,childstep] (int op, int oa)
+			{
+				build(pa + oa, childstep, pt + op*K);
+			});
+		}
+
+		/// parent configuration index from the states of the parents, in the order of the factor dimensions
+		template <class...X>
+		static int parentindex(X... I)
+		{
+			return MultiDimNBase<T,parents_t>().offset(I...);
+		}
+
+		/// draws the state of child for parent configuration parent given u uniform in [0,1)
+		int draw(int parent, double u) const
+		{
+			const double x = u*K;
+			const int i = std::min((int)x, K-1);
+			const entry & e = table_[parent*K+i];
+			return x-i < e.prob ? i : e.alias;
+		}
+
+		/// draws with a uniform random number generator g, arithmetic arguments go to the overload above
+		template <class URNG>
+		auto draw(int parent, URNG & g) const -> typename std::enable_if<!std::is_arithmetic<URNG>::value,int>::type
+		{
+			return draw(parent, std::uniform_real_distribution<double>()(g));
+		}
+
+		/// draws one state for every row of parents, a N x (ndims-1) integer matrix of parent states
+		template <class Derived, class URNG>
+		void draw(const Eigen::MatrixBase<Derived> & parents, Eigen::Matrix<int,Eigen::Dynamic,1> & out, URNG & g) const
+		{
+			assert(parents.cols() == parents_t::size);
+			MULTIDIM_PROBE("sampler_draw", TS, "alias", parents.rows(), parents.rows()*(parents_t::size*sizeof(int) + sizeof(entry) + sizeof(int)));
+			Eigen::Matrix<int,Eigen::Dynamic,1> steps(int(parents_t::size));
+			for(int j = 0; j < parents_t::size; j++)
+				steps[j] = MultiDimNBase<T,parents_t>().getstep(j);
+			const Eigen::Matrix<int,Eigen::Dynamic,1> index = parents.template cast<int>() * steps;
+
+			std::uniform_real_distribution<double> d;
+			out.resize(parents.rows());
+			for(int n = 0; n < out.size(); n++)
+				out[n] = draw(index[n], d(g));
+		}
+
+		const std::vector<entry> & table() const { return table_; }
+
+	private:
+		/// alias table of the K values p[k*step] into t
+		static void build(const T * p, int step, entry * t)
+		{
+			T s = 0;
+			for(int k = 0; k < K; k++)
+				s += p[k*step];
+
+			T q[K];
+			int small[K], large[K];
+			int ns = 0, nl = 0;
+			for(int k = 0; k < K; k++)
+			{
+				q[k] = s > 0 ? p[k*step]*K/s : T(1);
+				if(q[k] < 1)
+					small[ns++] = k;
+				else
+					large[nl++] = k;
+			}
+			while(ns > 0 && nl > 0)
+			{
+				const int l = small[--ns];
+				const int g = large[nl-1];
+				t[l].prob = q[l];
+				t[l].alias = g;
+				q[g] -= 1 - q[l];
+				if(q[g] < 1)
+				{
+					nl--;
+					small[ns++] = g;
+				}
+			}
+			// leftovers are 1 up to rounding
+			while(nl > 0)
+			{
+				const int g = large[--nl];
+				t[g].prob = 1;
+				t[g].alias = g;
+			}
+			while(ns > 0)
+			{
+				const int l = small[--ns];
+				t[l].prob = 1;
+				t[l].alias = l;
+			}
+		}
+
+		std::vector<entry> table_;
+	};
+}
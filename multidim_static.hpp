@@ -10,16 +10,65 @@
  */
 #pragma once
 #include <Eigen/Dense>
+#include <cstdint>
 #include <initializer_list>
 #include <iostream>
 #include <type_traits>
 #include "multidim_details.hpp"
+#include "multidim_instrument.hpp"
 
 namespace multidim
 {
 	template <class T, class TS>
 	class MultiDimNView;
 
+	namespace details
+	{
+		/// over-aligned heap allocation for types whose alignment exceeds the one of operator new
+		inline void * alignednew(std::size_t n, std::size_t align)
+		{
+			void * raw = ::operator new(n + align + sizeof(void*));
+			const std::uintptr_t p = (reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*) + align - 1) & ~std::uintptr_t(align - 1);
+			reinterpret_cast<void**>(p)[-1] = raw;
+			return reinterpret_cast<void*>(p);
+		}
+
+		inline void aligneddelete(void * p)
+		{
+			if(p)
+				::operator delete(reinterpret_cast<void**>(p)[-1]);
+		}
+
+		/// storage alignment in bytes of a MultiDimN: rows of padded layouts start on a multiple of
+		/// their pitch (up to 64), layouts without padding keep the alignment of their Eigen storage
+		template <class T, class TS, bool padded = storageseq<TS>::value != productseq<TS>::value>
+		struct storagealignof {
+			static constexpr std::size_t value = alignof(Eigen::Matrix<T,storageseq<TS>::value,1>);
+		};
+
+		template <class T, class TS>
+		struct storagealignof<T,TS,true> {
+			static constexpr std::size_t value = storagealign<TS,sizeof(T)>::value > storagealignof<T,TS,false>::value ? 
+				storagealign<TS,sizeof(T)>::value : storagealignof<T,TS,false>::value;
+		};
+
+		/// class operator new/delete honouring align, only for padded storage
+		template <std::size_t align, bool padded>
+		struct alignedalloc {};
+
+		template <std::size_t align>
+		struct alignedalloc<align,true>
+		{
+			static void * operator new(std::size_t n) { return alignednew(n, align); }
+
+			static void * operator new[](std::size_t n) { return alignednew(n, align); }
+
+			static void operator delete(void * p) { aligneddelete(p); }
+
+			static void operator delete[](void * p) { aligneddelete(p); }
+		};
+	}
+
 	/**
 	 * Base class of Multidimensional Static matrix of elements of type T
 	 *
@@ -31,8 +80,10 @@ namespace multidim
 	{
 	public:
 		using value_t = T;
+		using layout_t = TS;
 		static constexpr int Ncount = TS::size;
 		static constexpr int Ntot = details::productseq<TS>::value;
+		static constexpr int Nstorage = details::storageseq<TS>::value; // Ntot plus row padding
 		using indexvector_t = Eigen::Matrix<int,Ncount,1>; // instead of std::vector<int>
 
 		template <int i>
@@ -56,6 +107,9 @@ namespace multidim
 
 		constexpr int numel() const { return Ntot; } 
 
+		/// number of elements of the underlying storage, padding included
+		constexpr int nstorage() const { return Nstorage; } 
+
 		/// compile type via pack: offsetvalue<1,2,3,4>::value
 		template<int... I>
 		using offsetvalue = typename details::offsetcompute<TS,I...>::type;
@@ -113,14 +167,19 @@ namespace multidim
 
 		T * data() { return data_; }
 
+		/// views can be strided or padded: only the logical elements are written
 		void setOnes()
 		{
-			map_t(data_).setOnes();	
+			MULTIDIM_PROBE("setOnes", TS, details::kernelpathof<TS>::value, base_t::Ntot, base_t::Ntot*sizeof(T));
+			T * p = data_;
+			details::foreachoffset<TS>([p] (int o) { p[o] = T(1); });
 		}
 
 		void setZero()
 		{
-			map_t(data_).setZero();	
+			MULTIDIM_PROBE("setZero", TS, details::kernelpathof<TS>::value, base_t::Ntot, base_t::Ntot*sizeof(T));
+			T * p = data_;
+			details::foreachoffset<TS>([p] (int o) { p[o] = T(0); });
 		}
 
 		/// COMMON ACROSS MultiDimNView and MultiDimN
@@ -157,6 +216,7 @@ namespace multidim
 			using RT = MultiDimNView<T, typename details::rowmajorstepper<N...> >;
 
 			static_assert(RT::Ntot == MultiDimNBase<T,TS>::Ntot,"result requires same number of elements");
+			static_assert(details::spanseq<TS>::value == MultiDimNBase<T,TS>::Ntot,"reshape requires a dense layout");
 			return data();
 		}		
 
@@ -166,6 +226,7 @@ namespace multidim
 			using RT = MultiDimNView<T, typename details::colmajorstepper<N...> >;
 
 			static_assert(RT::Ntot == MultiDimNBase<T,TS>::Ntot,"result requires same number of elements");
+			static_assert(details::spanseq<TS>::value == MultiDimNBase<T,TS>::Ntot,"reshape requires a dense layout");
 			return data();
 		}			
 
@@ -180,27 +241,40 @@ namespace multidim
 
 	// column wise
 	template <class T, class TS>
-	class MultiDimN: public MultiDimNBase<T,TS>
+	class MultiDimN: public MultiDimNBase<T,TS>, 
+		public details::alignedalloc<details::storagealignof<T,TS>::value, details::storageseq<TS>::value != details::productseq<TS>::value>
 	{
 	public:
-		using data_t = Eigen::Matrix<T,MultiDimNBase<T,TS>::Ntot,1>;
+		using data_t = Eigen::Matrix<T,MultiDimNBase<T,TS>::Nstorage,1>;
+
+		/// storage alignment in bytes, see details::storagealignof
+		static constexpr std::size_t Nalign = details::storagealignof<T,TS>::value;
 
+		/// padding lanes start zeroed: the padded kernels read them
 		MultiDimN()
 		{
-
+			zeropadding(boolholder<MultiDimNBase<T,TS>::Nstorage != MultiDimNBase<T,TS>::Ntot>());
 		}
 
 		const T * data() const { return data_.data(); }
 
 		T * data() { return data_.data(); }
 
+		/// whole storage, padding lanes included, for kernels that can run full-width vectors
+		data_t & storage() { return data_; }
+
+		const data_t & storage() const { return data_; }
+
+		/// padding lanes are written too: they are never read back as logical elements
 		void setOnes()
 		{
+			MULTIDIM_PROBE("setOnes", TS, "storage", details::storageseq<TS>::value, details::storageseq<TS>::value*sizeof(T));
 			data_.setOnes();	
 		}
 
 		void setZero()
 		{
+			MULTIDIM_PROBE("setZero", TS, "storage", details::storageseq<TS>::value, details::storageseq<TS>::value*sizeof(T));
 			data_.setZero();	
 		}
 
@@ -237,6 +311,7 @@ namespace multidim
 			using RT = MultiDimNView<T, typename details::rowmajorstepper<N...> >;
 
 			static_assert(RT::Ntot == MultiDimNBase<T,TS>::Ntot,"result requires same number of elements");
+			static_assert(MultiDimNBase<T,TS>::Nstorage == MultiDimNBase<T,TS>::Ntot,"reshape requires a non padded layout");
 			return data();
 		}		
 
@@ -246,6 +321,7 @@ namespace multidim
 			using RT = MultiDimNView<T, typename details::colmajorstepper<N...> >;
 
 			static_assert(RT::Ntot == MultiDimNBase<T,TS>::Ntot,"result requires same number of elements");
+			static_assert(MultiDimNBase<T,TS>::Nstorage == MultiDimNBase<T,TS>::Ntot,"reshape requires a non padded layout");
 			return data();
 		}			
 
@@ -255,10 +331,37 @@ namespace multidim
 		}
 
 	private:
-		data_t data_;
+		void zeropadding(std::false_type) {}
+
+		/// only the lanes past every row when the layout tiles into rows, otherwise all the storage
+		void zeropadding(std::true_type)
+		{
+			using P = details::paddedlayout<TS>;
+			if(!P::value)
+			{
+				data_.setZero();
+				return;
+			}
+			T * p = data_.data();
+			for(int r = 0; r < P::rows; r++)
+				for(int l = P::rowsize; l < P::pitch; l++)
+					p[r*P::pitch+l] = T(0);
+		}
+
+		alignas(Nalign) data_t data_;
 	};
 
 
+	namespace details
+	{
+		/// MultiDimN owns its storage, padding lanes included, while a view can alias live data there
+		template <class A>
+		struct isowner : std::false_type {};
+
+		template <class T, class TS>
+		struct isowner<MultiDimN<T,TS> > : std::true_type {};
+	}
+
 	/// declares a multidim with type T and given dimensions in row-major
 	template <class T, int...N>
 	using MultiDimNRow = MultiDimN<T, typename details::rowmajorstepper<N...> >;
@@ -266,4 +369,14 @@ namespace multidim
 	/// declares a multidim with type T and given dimensions in col-major
 	template <class T, int...N>
 	using MultiDimNCol = MultiDimN<T, typename details::colmajorstepper<N...> >;
+
+	/// declares a multidim with type T in row-major whose last dimension is padded to align elements
+	/// e.g. MultiDimNRowPadded<double,4,3,5> has steps (8,1): every row starts on a multiple of 4 elements
+	/// and the storage is aligned to the pitch (8 doubles, capped at 64 bytes) so rows are aligned in memory too
+	template <class T, int align, int...N>
+	using MultiDimNRowPadded = MultiDimN<T, typename details::rowmajorpaddedstepper<align,N...> >;
+
+	/// declares a multidim with type T in col-major whose first dimension is padded to align elements
+	template <class T, int align, int...N>
+	using MultiDimNColPadded = MultiDimN<T, typename details::colmajorpaddedstepper<align,N...> >;
 }
\ No newline at end of file
@@ -6,7 +6,10 @@
  *
  * Core functionalities ... the rest is "trivial"
  */
-#include "multidim_static.hpp"
+#include "multidim_batch.hpp"
+#include "multidim_cache.hpp"
+#include "multidim_learn.hpp"
+#include "multidim_sample.hpp"
 #include <iostream>
 
 template <class T>
@@ -25,6 +28,7 @@ void dumpinfo(const T& x,const char * name)
 		std::cout << x.getstep(i) << " ";
 	}
 	std::cout << std::endl;
+	std::cout << " storage: " << x.nstorage() << std::endl;
 }
 
 int main(int argc, char const *argv[])
@@ -57,6 +61,150 @@ int main(int argc, char const *argv[])
 
 	dumpinfo(X().reshapeC<5,3,2,7,4,2>().reshapeR<5,3,2,7,4,2>(),"reshape row major(5,3,2,7,4,2)");
 	
+	using P = multidim::MultiDimNRowPadded<double,4,2,3,5> ;
+	dumpinfo(P(),"padded byrow(2,3,5) to 4");
+	dumpinfo(multidim::MultiDimNColPadded<double,4,3,2>(),"padded bycol(3,2) to 4");
+	P().setZero();
+
+	// kernels: unrolled (Ntot < MULTIDIM_UNROLL_THRESHOLD), dense and strided
+	{
+		P p;
+		p.setZero();
+		multidim::apply(p, [] (double) { return 2.0; });
+		std::cout << "padded sum " << multidim::sum(p) << " expected 60" << std::endl;
+		multidim::MultiDimNRow<double,2,3> m;
+		multidim::sumout<2>(p, m);
+		std::cout << "padded sumout " << multidim::sum(m) << " expected 60" << std::endl;
+		multidim::normalize<2>(p);
+		std::cout << "normalized rows " << multidim::sum(p) << " expected 6" << std::endl;
+
+		// padded path: full rows of 8 lanes over the storage, 3 padding lanes ignored
+		multidim::MultiDimNRowPadded<double,4,16,5> q, r;
+		static_assert(multidim::details::paddedlayout<decltype(q)::layout_t>::value,"padded layout");
+		q.setOnes();
+		r.setOnes();
+		multidim::apply(q, [] (double a) { return 3*a; });
+		multidim::apply2(q, r, [] (double a, double b) { return a+b; });
+		std::cout << "padded lanes sum " << multidim::sum(q) << " expected 320" << std::endl;
+		std::cout << "padded view sum " << multidim::sum(q.limit1<1>(4)) << " expected 64" << std::endl;
+
+		X x;
+		x.setOnes();
+		std::cout << "dense sum " << multidim::sum(x) << " expected 1680" << std::endl;
+		multidim::MultiDimNRow<double,7,8> s;
+		s.setOnes();
+		multidim::apply2(x.limit1<0>(1).limit1<0>(3), s, [] (double a, double b) { return a+b; });
+		std::cout << "strided sum " << multidim::sum(x.limit1<2>(1)) << " expected 248" << std::endl;
+
+		multidim::MultiDimNRow<double,3> v;
+		for(int i = 0; i < 3; i++)
+			v.data()[i] = i;
+		multidim::MultiDimNCol<double,2,3,4> e;
+		multidim::expand<1>(v, e);
+		std::cout << "expanded sum " << multidim::sum(e) << " expected 24" << std::endl;
+	}
+
+	// batched: kernels run across the instances
+	{
+		multidim::MultiDimNBatchRow<double,2,3> b(100);
+		multidim::MultiDimNRow<double,2,3> f;
+		for(int i = 0; i < f.numel(); i++)
+			f.data()[i] = i+1;
+		b.setOnes();
+		b.set(7, f);
+		multidim::MultiDimNBatchRow<double,2,3> b2(b.batch());
+		b2.setOnes();
+		multidim::apply2(b2, b, [] (double a, double c) { return a+c; });
+		multidim::multiply(b, f);
+		multidim::multiply(b, b2);
+		multidim::apply(b, [] (double a) { return 2*a; });
+		multidim::normalize<1>(b);
+		multidim::MultiDimNBatchRow<double,2> m(b.batch());
+		multidim::sumout<1>(b, m);
+		std::cout << "batched sum " << multidim::sum(m).sum() << " expected 200" << std::endl;
+		b.get(7, f);
+		std::cout << "batched instance " << f.data()[5] << " expected " << 36.0*7/(16*5+25*6+36*7) << std::endl;
+		multidim::normalize(b2);
+		std::cout << "batched normalized " << multidim::sum(b2).sum() << " expected " << b2.batch() << std::endl;
+	}
+
+	// batched evidence conditioning over dimensions 0 and 2
+	{
+		multidim::MultiDimNRow<double,3,4,2> f;
+		for(int i = 0; i < f.numel(); i++)
+			f.data()[i] = i;
+		Eigen::Matrix<int,Eigen::Dynamic,2> ev(5,2);
+		ev << 0,0, 1,1, 2,0, 2,1, 1,0;
+		multidim::MultiDimNBatchRow<double,4> g(ev.rows());
+		multidim::gather<0,2>(f, ev, g);
+		std::cout << "gather " << g.col(3)(3) << " expected " << f.limit1<0>(2).limit1<1>(1).data()[3*2] << std::endl;
+	}
+
+	// counts from records, states of dimension 1 in the first column and of dimension 0 in the second
+	{
+		const int N = 100000;
+		Eigen::Matrix<int,Eigen::Dynamic,2> records(N,2);
+		for(int i = 0; i < N; i++)
+			records.row(i) << i % 4, (i / 4) % 3;
+		multidim::MultiDimNRow<double,3,4> c;
+		c.setZero();
+		multidim::accumulate_counts<1,0>(c, records, 4);
+		std::cout << "counts " << multidim::sum(c) << " expected " << N << std::endl;
+		multidim::MultiDimNRow<double,3,4> w;
+		w.setZero();
+		multidim::accumulate_counts<1,0>(w, records, Eigen::VectorXd::Constant(N,0.5), 3);
+		std::cout << "weighted counts " << w.data()[w.offset(2,3)] << " expected " << c.data()[c.offset(2,3)]/2 << std::endl;
+		// no room for private tables: threads own ranges of the table
+		multidim::MultiDimNRow<double,3,4> o;
+		o.setZero();
+		multidim::accumulate_counts<1,0>(o, records, 4, 0);
+		std::cout << "owner counts " << (o.storage()-c.storage()).cwiseAbs().maxCoeff() << " " << multidim::sum(o) << " expected 0 " << N << std::endl;
+	}
+
+	// sampling dimension 1 given dimension 0
+	{
+		multidim::MultiDimNRow<double,3,4> f;
+		for(int i = 0; i < f.numel(); i++)
+			f.data()[i] = i+1;
+		multidim::MultiDimNSampler<double,multidim::MultiDimNRow<double,3,4>::layout_t,1> sampler(f);
+		std::mt19937 g(1);
+		const int N = 200000;
+		Eigen::Matrix<int,Eigen::Dynamic,1> parents = Eigen::Matrix<int,Eigen::Dynamic,1>::Constant(N,1), states;
+		sampler.draw(parents, states, g);
+		std::cout << "sampled frequency " << (states.array() == 3).count()/double(N) << " expected about " << 8.0/26 << std::endl;
+		float u = 0.9f;
+		std::cout << "sampled from float " << sampler.draw(1, u) << " expected 3" << std::endl;
+	}
+
+	// incremental marginal of dimension 2 with updates along dimension 1
+	{
+		using F = multidim::MultiDimNRow<double,3,4,5>;
+		F f;
+		for(int i = 0; i < f.numel(); i++)
+			f.data()[i] = i;
+		multidim::MultiDimNCachedSum<double,F::layout_t,1,2> cache(f);
+		multidim::MultiDimNCachedSum<double,F::layout_t,1,1> cacheupd(f);
+		cache.slice(2).setOnes();
+		cacheupd.markdirty(2);
+		cache.block<2>(0).setZero();
+		cacheupd.markdirty(0);
+		cacheupd.markdirty(1);
+		multidim::MultiDimNRow<double,3,5> m1;
+		multidim::MultiDimNRow<double,5> m2;
+		multidim::sumout<1>(f, m1);
+		multidim::sumout<0>(m1, m2);
+		std::cout << "cached marginal " << cache.marginal().data()[4] << " expected " << m2.data()[4] << std::endl;
+		const double * pu = cacheupd.marginal().data();
+		std::cout << "cached marginal " << pu[0] << " " << pu[1] << " " << pu[2] << " expected " << multidim::sum(f.limit1<1>(0)) << " " << multidim::sum(f.limit1<1>(1)) << " " << multidim::sum(f.limit1<1>(2)) << std::endl;
+		// writes through a held view after a refresh
+		auto v = cache.slice(1);
+		cache.marginal();
+		v.setOnes();
+		multidim::sumout<1>(f, m1);
+		multidim::sumout<0>(m1, m2);
+		std::cout << "held view marginal " << cache.marginal().data()[4] << " expected " << m2.data()[4] << std::endl;
+	}
+
 	// as static
 	// as args
 	// as initializer list
@@ -66,6 +214,11 @@ int main(int argc, char const *argv[])
 	//compiletime: std::cout << "offset " << X().offset(0,1,2,2,3) << std::endl;
 	//runtime: std::cout << "offset " << X().offset({0,1,2,2,4}) << std::endl;
 
+#ifdef MULTIDIM_INSTRUMENT
+	multidim::instrument::registry::get().dumpjson(std::cout);
+	multidim::instrument::registry::get().dumpcsv(std::cout);
+#endif
+
 //	std::cout << "dimension 3 is " << x.getsize<3>() << std::endl;
 //	std::cout << "dimension 3 is " << x.getsize(3) << std::endl;
 	return 0;